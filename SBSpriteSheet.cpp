@@ -0,0 +1,181 @@
+﻿#include "SBSpriteSheet.h"
+
+#include <Urho3D/Graphics/Texture2D.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Urho3D
+{
+
+SBSpriteSheet::SBSpriteSheet(Context* context) :
+    Object(context),
+    data_(nullptr),
+    size_(0),
+    mapped_(false),
+    frames_(nullptr),
+    frameCount_(0)
+{
+}
+
+SBSpriteSheet::~SBSpriteSheet()
+{
+    Close();
+}
+
+bool SBSpriteSheet::Load(const String& name)
+{
+    Close();
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+    // Пустая строка, если файл не лежит в папке ресурсов.
+    String fileName = cache->GetResourceFileName(name);
+
+    if (fileName.Empty() || !Map(fileName))
+    {
+        SharedPtr<File> file = cache->GetFile(name);
+        if (!file)
+            return false;
+
+        buffer_.Resize(file->GetSize());
+        if (file->Read(buffer_.Buffer(), buffer_.Size()) != buffer_.Size())
+        {
+            URHO3D_LOGERROR("Could not read " + name);
+            Close();
+            return false;
+        }
+
+        data_ = buffer_.Buffer();
+        size_ = buffer_.Size();
+    }
+
+    if (!Parse(name))
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool SBSpriteSheet::Map(const String& fileName)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(WString(GetNativePath(fileName)).CString(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+
+    // Отображение остается действительным и после закрытия дескрипторов.
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data)
+        return false;
+
+    size_ = (unsigned)fileSize.QuadPart;
+#else
+    int file = open(GetNativePath(fileName).CString(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(file);
+        return false;
+    }
+
+    // Отображение остается действительным и после закрытия файла.
+    void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+
+    size_ = (unsigned)fileStat.st_size;
+#endif
+
+    data_ = (const unsigned char*)data;
+    mapped_ = true;
+    return true;
+}
+
+bool SBSpriteSheet::Parse(const String& name)
+{
+    const SBSheetHeader* header = (const SBSheetHeader*)data_;
+
+    if (size_ < sizeof(SBSheetHeader) || String(header->id_, 4) != SHEET_FILE_ID || header->version_ != SHEET_VERSION)
+    {
+        URHO3D_LOGERROR(name + " is not a supported sprite sheet");
+        return false;
+    }
+
+    // Размеры из заголовка сравниваются с остатком файла, а не складываются,
+    // иначе при большом количестве кадров произведение переполнится и проверка пройдет.
+    unsigned dataSize = size_ - sizeof(SBSheetHeader);
+    if (header->frameCount_ > dataSize / sizeof(SBSheetFrame))
+    {
+        URHO3D_LOGERROR(name + " is corrupted");
+        return false;
+    }
+
+    unsigned framesSize = header->frameCount_ * sizeof(SBSheetFrame);
+    if (header->textureNameLength_ > dataSize - framesSize)
+    {
+        URHO3D_LOGERROR(name + " is corrupted");
+        return false;
+    }
+
+    frames_ = (const SBSheetFrame*)(data_ + sizeof(SBSheetHeader));
+    frameCount_ = header->frameCount_;
+
+    // Как и в SpriteSheet2D, путь к текстуре задается относительно атласа.
+    String textureName((const char*)data_ + sizeof(SBSheetHeader) + framesSize, header->textureNameLength_);
+    texture_ = GetSubsystem<ResourceCache>()->GetResource<Texture2D>(GetParentPath(name) + textureName);
+
+    return texture_.NotNull();
+}
+
+void SBSpriteSheet::Close()
+{
+    if (mapped_)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap((void*)data_, size_);
+#endif
+    }
+
+    buffer_.Clear();
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    frames_ = nullptr;
+    frameCount_ = 0;
+    texture_.Reset();
+}
+
+}
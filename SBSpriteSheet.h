@@ -0,0 +1,97 @@
+﻿/*
+    Бинарный атлас спрайтов. Файл отображается в память и используется без разбора:
+    для каждого кадра уже посчитаны текстурные координаты, размеры и точка привязки.
+
+    Файл создается из XML-атласа Urho2D (TextureAtlas) утилитой SpriteSheetConverter.
+
+    Использование:
+    SharedPtr<SBSpriteSheet> sheet(new SBSpriteSheet(context_));
+    sheet->Load("Urho2D/Sheet.sbs");
+    ...
+    spriteBatch_->Draw(sheet, frameId, Vector2(100, 100));
+*/
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+
+using namespace Urho3D;
+
+namespace Urho3D
+{
+
+class Texture2D;
+
+// Заголовок и версия файла атласа. Используются и SBSpriteSheet, и SpriteSheetConverter.
+#define SHEET_FILE_ID "SBSH"
+#define SHEET_VERSION 1
+
+// Заголовок файла. За ним идут кадры (SBSheetFrame), а потом имя текстуры
+// относительно папки атласа (без нуля в конце).
+struct SBSheetHeader
+{
+    char id_[4];
+    unsigned version_;
+    unsigned frameCount_;
+    unsigned textureNameLength_;
+};
+
+// Кадр атласа. Структура читается из файла как есть, поэтому ее размер и порядок полей менять нельзя.
+struct SBSheetFrame
+{
+    // Область текстуры в текстурных координатах [0, 1].
+    Rect uv_;
+
+    // Точка привязки в пикселях от верхнего левого угла кадра.
+    Vector2 pivot_;
+
+    // Размеры кадра в пикселях.
+    Vector2 size_;
+};
+
+// Конвертер пишет эти структуры в файл целиком, поэтому их размеры не должны зависеть от компилятора.
+static_assert(sizeof(SBSheetHeader) == 16, "Unexpected SBSheetHeader size");
+static_assert(sizeof(SBSheetFrame) == 32, "Unexpected SBSheetFrame size");
+
+class URHO3D_API SBSpriteSheet : public Object
+{
+    URHO3D_OBJECT(SBSpriteSheet, Object);
+
+public:
+    SBSpriteSheet(Context* context);
+    virtual ~SBSpriteSheet();
+
+    // Загружает атлас по имени ресурса. Если файл лежит в папке ресурсов, то он отображается
+    // в память, иначе (например, в пакете) читается целиком.
+    bool Load(const String& name);
+
+    void Close();
+
+    Texture2D* GetTexture() const { return texture_; }
+
+    unsigned GetFrameCount() const { return frameCount_; }
+
+    // Никакие проверки не производятся, frameId должен быть меньше GetFrameCount().
+    const SBSheetFrame& GetFrame(unsigned frameId) const { return frames_[frameId]; }
+
+protected:
+    // Содержимое файла: либо отображение в память, либо buffer_.
+    const unsigned char* data_;
+    unsigned size_;
+    bool mapped_;
+    PODVector<unsigned char> buffer_;
+
+    // Указатель на массив кадров внутри data_.
+    const SBSheetFrame* frames_;
+    unsigned frameCount_;
+
+    SharedPtr<Texture2D> texture_;
+
+    // Отображает файл в память. Возвращает false, если это невозможно.
+    bool Map(const String& fileName);
+
+    // Проверяет заголовок и находит кадры и имя текстуры.
+    bool Parse(const String& name);
+};
+
+}
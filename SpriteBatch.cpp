@@ -1,10 +1,16 @@
 ﻿#include "SpriteBatch.h"
+#include "SBSpriteSheet.h"
 
+#include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Graphics/Camera.h>
 #include <Urho3D/Graphics/Graphics.h>
 #include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Renderer.h>
 #include <Urho3D/Graphics/Texture2D.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
 #include <Urho3D/UI/Font.h>
 #include <Urho3D/UI/FontFace.h>
 
@@ -16,9 +22,48 @@
 // в вершинном буфере каждый спрайт занимает 4 элемента.
 #define VERTICES_PER_SPRITE 4
 
+// Заголовок и версия файла записи.
+#define CAPTURE_FILE_ID "SBCP"
+#define CAPTURE_VERSION 1
+
+// Имя встроенной белой текстуры. По нему она находится при воспроизведении записи.
+#define WHITE_TEXTURE_NAME "SpriteBatch/WhitePixel"
+
 namespace Urho3D
 {
 
+// Команды в файле записи. Каждая команда начинается с одного байта.
+enum SBCaptureCommand
+{
+    // Начало кадра. Дальше идет время кадра в миллисекундах от начала записи.
+    SBC_FRAME = 0,
+
+    // Вызовы функций SpriteBatch с аргументами.
+    SBC_BEGIN,
+    SBC_DRAW,
+    SBC_DRAW_STRING,
+    SBC_END,
+
+    // Описания ресурсов. Пишутся один раз перед первой командой, которая их использует.
+    // Идентификаторы текстур и шрифтов - порядковые номера описаний в файле.
+    SBC_TEXTURE,
+    SBC_FONT,
+    SBC_RENDER_STATE
+};
+
+// Класс порции по трансформации спрайтов. Определяет специализацию WritePortionVertices().
+enum SBPortionTransform
+{
+    // Ни один спрайт не повернут и не отмасштабирован.
+    SBPT_AXIS_ALIGNED = 0,
+
+    // Все спрайты повернуты или отмасштабированы.
+    SBPT_TRANSFORMED,
+
+    // Есть и те, и другие. Проверка делается для каждого спрайта.
+    SBPT_MIXED
+};
+
 // Атрибуты вершин.
 struct SBVertex
 {
@@ -54,22 +99,55 @@ SpriteBatch::SpriteBatch(Context *context, unsigned maxPortionSize) :
     }
     indexBuffer_->Unlock();
 
+    graphics_ = GetSubsystem<Graphics>();
+
+    // Без графической подсистемы (воспроизведение записи в режиме -headless) вершины
+    // пишутся только в память CPU.
+    vertexBuffer_->SetShadowed(!graphics_);
     vertexBuffer_->SetSize(maxPortionSize_ * VERTICES_PER_SPRITE,
                            MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1, true);
 
-    graphics_ = GetSubsystem<Graphics>();
-    spriteVS_ = graphics_->GetShader(VS, "Basic", "DIFFMAP VERTEXCOLOR");
-    spritePS_ = graphics_->GetShader(PS, "Basic", "DIFFMAP VERTEXCOLOR");
-    ttfTextVS_ = graphics_->GetShader(VS, "Text");
-    ttfTextPS_ = graphics_->GetShader(PS, "Text", "ALPHAMAP");
-    spriteTextVS_ = graphics_->GetShader(VS, "Text");
-    spriteTextPS_ = graphics_->GetShader(PS, "Text");
-    sdfTextVS_ = graphics_->GetShader(VS, "Text");
-    sdfTextPS_ = graphics_->GetShader(PS, "Text", "SIGNED_DISTANCE_FIELD");
+    if (graphics_)
+    {
+        spriteVS_ = graphics_->GetShader(VS, "Basic", "DIFFMAP VERTEXCOLOR");
+        spritePS_ = graphics_->GetShader(PS, "Basic", "DIFFMAP VERTEXCOLOR");
+        ttfTextVS_ = graphics_->GetShader(VS, "Text");
+        ttfTextPS_ = graphics_->GetShader(PS, "Text", "ALPHAMAP");
+        spriteTextVS_ = graphics_->GetShader(VS, "Text");
+        spriteTextPS_ = graphics_->GetShader(PS, "Text");
+        sdfTextVS_ = graphics_->GetShader(VS, "Text");
+        sdfTextPS_ = graphics_->GetShader(PS, "Text", "SIGNED_DISTANCE_FIELD");
+    }
+    else
+    {
+        spriteVS_ = spritePS_ = nullptr;
+        ttfTextVS_ = ttfTextPS_ = nullptr;
+        spriteTextVS_ = spriteTextPS_ = nullptr;
+        sdfTextVS_ = sdfTextPS_ = nullptr;
+    }
+
+    // Состояние по умолчанию. Его режим наложения не используется, вместо него берется режим из Begin().
+    renderStates_.Push(SBRenderState());
+
+    defaultWhiteTexture_ = new Texture2D(context_);
+    defaultWhiteTexture_->SetName(WHITE_TEXTURE_NAME);
+    defaultWhiteTexture_->SetNumLevels(1);
+    defaultWhiteTexture_->SetSize(1, 1, Graphics::GetRGBAFormat());
+    if (graphics_)
+        UploadWhiteTexture();
+    SetWhitePixel();
+}
+
+void SpriteBatch::UploadWhiteTexture()
+{
+    unsigned white = 0xffffffff;
+    defaultWhiteTexture_->SetData(0, 0, 0, 1, 1, &white);
+    defaultWhiteTexture_->ClearDataLost();
 }
 
 SpriteBatch::~SpriteBatch()
 {
+    StopCapture();
 }
 
 void SpriteBatch::Begin(BlendMode blendMode, CompareMode compareMode, float z, Camera* camera)
@@ -78,65 +156,157 @@ void SpriteBatch::Begin(BlendMode blendMode, CompareMode compareMode, float z, C
     compareMode_ = compareMode;
     z_ = z;
     camera_ = camera;
+    useReplayViewProj_ = false;
 
     sprites_.Clear();
 
+    if (graphics_)
+        screenSize_ = IntVector2(graphics_->GetWidth(), graphics_->GetHeight());
+
+    if (captureFile_)
+    {
+        CaptureFrameStart();
+        captureBuffer_.WriteUByte(SBC_BEGIN);
+        captureBuffer_.WriteUByte((unsigned char)blendMode);
+        captureBuffer_.WriteUByte((unsigned char)compareMode);
+        captureBuffer_.WriteFloat(z);
+        captureBuffer_.WriteIntVector2(virtualScreenSize_);
+        captureBuffer_.WriteIntVector2(screenSize_);
+        captureBuffer_.WriteBool(camera != nullptr);
+        if (camera)
+            captureBuffer_.WriteMatrix4(GetViewProjMatrix());
+        captureBatch_ = true;
+    }
+
     // Вычисляем viewportRect_.
     if (virtualScreenSize_.x_ <= 0 || virtualScreenSize_.y_ <= 0)
     {
         // Виртуальный экран не используется. Вьюпорт занимает все окно.
-        viewportRect_ = IntRect(0, 0, graphics_->GetWidth(), graphics_->GetHeight());
+        viewportRect_ = IntRect(0, 0, screenSize_.x_, screenSize_.y_);
     }
     else
     {
-        float realAspect = (float)graphics_->GetWidth() / graphics_->GetHeight();
+        float realAspect = (float)screenSize_.x_ / screenSize_.y_;
         float virtualAspect = (float)virtualScreenSize_.x_ / virtualScreenSize_.y_;
 
         float virtualScreenScale;
         if (realAspect > virtualAspect)
         {
             // Окно шире, чем надо. Будут черные полосы по бокам.
-            virtualScreenScale = (float)graphics_->GetHeight() / virtualScreenSize_.y_;
+            virtualScreenScale = (float)screenSize_.y_ / virtualScreenSize_.y_;
         }
         else
         {
             // Высота окна больше, чем надо. Будут черные полосы сверху и снизу.
-            virtualScreenScale = (float)graphics_->GetWidth() / virtualScreenSize_.x_;
+            virtualScreenScale = (float)screenSize_.x_ / virtualScreenSize_.x_;
         }
 
         int viewportWidth = (int)(virtualScreenSize_.x_ * virtualScreenScale);
         int viewportHeight = (int)(virtualScreenSize_.y_ * virtualScreenScale);
 
         // Центрируем вьюпорт.
-        int viewportX = (graphics_->GetWidth() - viewportWidth) / 2;
-        int viewportY = (graphics_->GetHeight() - viewportHeight) / 2;
+        int viewportX = (screenSize_.x_ - viewportWidth) / 2;
+        int viewportY = (screenSize_.y_ - viewportHeight) / 2;
 
         viewportRect_ = IntRect(viewportX, viewportY, viewportWidth + viewportX, viewportHeight + viewportY);
     }
+
+    // У текстуры виртуального экрана нет буфера глубины сцены, поэтому пакеты с камерой
+    // или с проверкой глубины рендерятся как обычно.
+    useRenderTexture_ = renderToTexture_ && graphics_ && !camera_ && compareMode_ == CMP_ALWAYS &&
+        virtualScreenSize_.x_ > 0 && virtualScreenSize_.y_ > 0;
+}
+
+unsigned SpriteBatch::AddRenderState(const SBRenderState& renderState)
+{
+    renderStates_.Push(renderState);
+    return renderStates_.Size() - 1;
+}
+
+const Vector2& SpriteBatch::GetInvTextureSize(Texture2D* texture)
+{
+    IntVector2 size(texture->GetWidth(), texture->GetHeight());
+    if (size != invTextureSizeKey_)
+    {
+        invTextureSizeKey_ = size;
+        invTextureSize_ = Vector2(1.0f / size.x_, 1.0f / size.y_);
+    }
+
+    return invTextureSize_;
 }
 
 void SpriteBatch::Draw(Texture2D* texture, const Rect& destination, Rect* source,
-    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects)
+    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects, unsigned renderState)
 {
+    // Переводим область текстуры из пикселей в текстурные координаты.
+    Rect uv(0.0f, 0.0f, 1.0f, 1.0f);
+    if (source)
+    {
+        const Vector2& invSize = GetInvTextureSize(texture);
+        uv = Rect(source->min_.x_ * invSize.x_, source->min_.y_ * invSize.y_,
+                  source->max_.x_ * invSize.x_, source->max_.y_ * invSize.y_);
+    }
+
+    PushSprite(texture, destination, uv, color, rotation, origin, scale, effects, renderState);
+}
+
+void SpriteBatch::Draw(SBSpriteSheet* sheet, unsigned frameId, const Vector2& position,
+    const Color& color, float rotation, const Vector2& scale, SBEffects effects, unsigned renderState)
+{
+    // Текстурные координаты, размеры и точка привязки уже посчитаны конвертером.
+    const SBSheetFrame& frame = sheet->GetFrame(frameId);
+    Rect destination(position, position + frame.size_);
+    PushSprite(sheet->GetTexture(), destination, frame.uv_, color, rotation, frame.pivot_, scale, effects, renderState);
+}
+
+void SpriteBatch::PushSprite(Texture2D* texture, const Rect& destination, const Rect& uv,
+    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects, unsigned renderState)
+{
+    const SBRenderState& state = GetRenderState(renderState);
+
     SBSprite sprite
     {
         texture,
         destination,
-        source ? *source : Rect(0.0f, 0.0f, (float)texture->GetWidth(), (float)texture->GetHeight()),
-        color,
+        uv,
+        color.ToUInt(),
         rotation,
         origin,
         scale,
         effects,
-        spriteVS_,
-        spritePS_
+        rotation != 0.0f || scale != Vector2::ONE,
+        state.vertexShader_ ? state.vertexShader_.Get() : spriteVS_,
+        state.pixelShader_ ? state.pixelShader_.Get() : spritePS_,
+        renderState == SB_DEFAULT_RENDER_STATE ? blendMode_ : state.blendMode_,
+        renderState
     };
 
     sprites_.Push(sprite);
+
+    if (captureBatch_)
+    {
+        // В файл пишется область текстуры в пикселях, как ее принимает Draw().
+        float w = (float)texture->GetWidth();
+        float h = (float)texture->GetHeight();
+        Rect source(uv.min_.x_ * w, uv.min_.y_ * h, uv.max_.x_ * w, uv.max_.y_ * h);
+
+        unsigned textureId = CaptureTexture(texture);
+        CaptureRenderState(renderState);
+        captureBuffer_.WriteUByte(SBC_DRAW);
+        captureBuffer_.WriteVLE(textureId);
+        captureBuffer_.WriteRect(destination);
+        captureBuffer_.WriteRect(source);
+        captureBuffer_.WriteUInt(color.ToUInt());
+        captureBuffer_.WriteFloat(rotation);
+        captureBuffer_.WriteVector2(origin);
+        captureBuffer_.WriteVector2(scale);
+        captureBuffer_.WriteUByte((unsigned char)effects);
+        captureBuffer_.WriteVLE(renderState);
+    }
 }
 
 void SpriteBatch::Draw(Texture2D* texture, const Vector2& position, Rect* source,
-    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects)
+    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects, unsigned renderState)
 {
     Rect destination
     {
@@ -146,17 +316,39 @@ void SpriteBatch::Draw(Texture2D* texture, const Vector2& position, Rect* source
         position.y_ + texture->GetHeight()
     };
 
-    Draw(texture, destination, source, color, rotation, origin, scale, effects);
+    Draw(texture, destination, source, color, rotation, origin, scale, effects, renderState);
 }
 
 void SpriteBatch::DrawString(const String& text, Font* font, float fontSize, const Vector2& position,
-    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects)
+    const Color& color, float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects, unsigned renderState)
 {
+    const SBRenderState& state = GetRenderState(renderState);
+
+    if (captureBatch_)
+    {
+        unsigned fontId = CaptureFont(font);
+        CaptureRenderState(renderState);
+        captureBuffer_.WriteUByte(SBC_DRAW_STRING);
+        captureBuffer_.WriteString(text);
+        captureBuffer_.WriteVLE(fontId);
+        captureBuffer_.WriteFloat(fontSize);
+        captureBuffer_.WriteVector2(position);
+        captureBuffer_.WriteUInt(color.ToUInt());
+        captureBuffer_.WriteFloat(rotation);
+        captureBuffer_.WriteVector2(origin);
+        captureBuffer_.WriteVector2(scale);
+        captureBuffer_.WriteUByte((unsigned char)effects);
+        captureBuffer_.WriteVLE(renderState);
+    }
+
     PODVector<unsigned> unicodeText;
     for (unsigned i = 0; i < text.Length();)
         unicodeText.Push(text.NextUTF8Char(i));
 
+    // Без графической подсистемы текстуры шрифта не создаются.
     FontFace* face = font->GetFace(fontSize);
+    if (!face)
+        return;
     Vector2 pos = position;
     Vector2 charOrig = origin;
 
@@ -172,6 +364,15 @@ void SpriteBatch::DrawString(const String& text, Font* font, float fontSize, con
     float sin, cos;
     SinCos(rotation, sin, cos);
 
+    // Одинаковы для всех символов строки.
+    unsigned packedColor = color.ToUInt();
+    bool transformed = rotation != 0.0f || scale != Vector2::ONE;
+
+    // Обратные размеры текстуры пересчитываются только при смене страницы шрифта.
+    Texture2D* pageTexture = nullptr;
+    float invw = 0.0f;
+    float invh = 0.0f;
+
     for (; i < unicodeText.Size(); i += step)
     {
         const FontGlyph* glyph = face->GetGlyph(unicodeText[i]);
@@ -204,18 +405,34 @@ void SpriteBatch::DrawString(const String& text, Font* font, float fontSize, con
             }
         }
 
+        if (state.vertexShader_)
+            vs = state.vertexShader_;
+        if (state.pixelShader_)
+            ps = state.pixelShader_;
+
+        Texture2D* texture = face->GetTextures()[glyph->page_];
+        if (texture != pageTexture)
+        {
+            pageTexture = texture;
+            invw = 1.0f / texture->GetWidth();
+            invh = 1.0f / texture->GetHeight();
+        }
+
         SBSprite sprite
         {
-            face->GetTextures()[glyph->page_],
+            texture,
             Rect(position.x_, position.y_, position.x_ + gw, position.y_ + gh),
-            Rect(gx, gy, gx + gw, gy + gh),
-            color,
+            Rect(gx * invw, gy * invh, (gx + gw) * invw, (gy + gh) * invh),
+            packedColor,
             rotation,
             (effects & SBE_FLIP_VERTICALLY) ? charOrig - Vector2(gox, 0.0f) : charOrig - Vector2(gox, goy),
             scale,
             effects,
+            transformed,
             vs,
-            ps
+            ps,
+            renderState == SB_DEFAULT_RENDER_STATE ? blendMode_ : state.blendMode_,
+            renderState
         };
 
         sprites_.Push(sprite);
@@ -223,37 +440,289 @@ void SpriteBatch::DrawString(const String& text, Font* font, float fontSize, con
     }
 }
 
+void SpriteBatch::SetWhitePixel(Texture2D* texture, const IntVector2& pixel)
+{
+    if (!texture)
+    {
+        texture = defaultWhiteTexture_;
+        whiteSource_ = Rect(0.5f, 0.5f, 0.5f, 0.5f);
+    }
+    else
+    {
+        Vector2 center((pixel.x_ + 0.5f) / texture->GetWidth(), (pixel.y_ + 0.5f) / texture->GetHeight());
+        whiteSource_ = Rect(center, center);
+    }
+
+    whiteTexture_ = texture;
+}
+
+void SpriteBatch::DrawLine(const Vector2& start, const Vector2& end, const Color& color, float thickness)
+{
+    // Горизонтальный прямоугольник длиной с отрезок поворачивается вокруг середины левого края.
+    Vector2 delta = end - start;
+    Rect destination(start.x_, start.y_, start.x_ + delta.Length(), start.y_ + thickness);
+    PushSprite(whiteTexture_, destination, whiteSource_, color, Atan2(delta.y_, delta.x_), Vector2(0.0f, thickness * 0.5f),
+        Vector2::ONE, SBE_NONE, SB_DEFAULT_RENDER_STATE);
+}
+
+void SpriteBatch::DrawRect(const Rect& rect, const Color& color)
+{
+    PushSprite(whiteTexture_, rect, whiteSource_, color, 0.0f, Vector2::ZERO, Vector2::ONE, SBE_NONE, SB_DEFAULT_RENDER_STATE);
+}
+
+void SpriteBatch::DrawRectOutline(const Rect& rect, const Color& color, float thickness)
+{
+    const Vector2& min = rect.min_;
+    const Vector2& max = rect.max_;
+
+    // Иначе боковые стороны получатся вывернутыми.
+    thickness = Min(thickness, Min(max.x_ - min.x_, max.y_ - min.y_) * 0.5f);
+
+    // Верхняя и нижняя стороны на всю ширину, боковые - между ними.
+    DrawRect(Rect(min.x_, min.y_, max.x_, min.y_ + thickness), color);
+    DrawRect(Rect(min.x_, max.y_ - thickness, max.x_, max.y_), color);
+    DrawRect(Rect(min.x_, min.y_ + thickness, min.x_ + thickness, max.y_ - thickness), color);
+    DrawRect(Rect(max.x_ - thickness, min.y_ + thickness, max.x_, max.y_ - thickness), color);
+}
+
+void SpriteBatch::DrawCircle(const Vector2& center, float radius, const Color& color, float thickness, unsigned segments)
+{
+    if (segments < 3)
+        segments = 3;
+
+    float step = 360.0f / segments;
+    Vector2 prev = center + Vector2(radius, 0.0f);
+    for (unsigned i = 1; i <= segments; i++)
+    {
+        float sin, cos;
+        SinCos(step * i, sin, cos);
+        Vector2 next = center + Vector2(cos * radius, sin * radius);
+        DrawLine(prev, next, color, thickness);
+        prev = next;
+    }
+}
+
+void SpriteBatch::DrawFilledCircle(const Vector2& center, float radius, const Color& color, float stripHeight)
+{
+    if (radius <= 0.0f)
+        return;
+
+    if (stripHeight <= 0.0f)
+        stripHeight = 1.0f;
+
+    // Полосы делаются одинаковыми, чтобы точно уложиться в диаметр.
+    unsigned stripCount = Max((unsigned)ceilf(radius * 2.0f / stripHeight), 1u);
+    stripHeight = radius * 2.0f / stripCount;
+
+    for (unsigned i = 0; i < stripCount; i++)
+    {
+        // Ширина полосы берется по ее середине.
+        float top = -radius + stripHeight * i;
+        float middle = top + stripHeight * 0.5f;
+        float halfWidth = sqrtf(Max(radius * radius - middle * middle, 0.0f));
+        DrawRect(Rect(center.x_ - halfWidth, center.y_ + top, center.x_ + halfWidth, center.y_ + top + stripHeight), color);
+    }
+}
+
+void SpriteBatch::DrawNineSlice(Texture2D* texture, const Rect& destination, const IntRect& border, Rect* source, const Color& color)
+{
+    Rect src = source ? *source : Rect(0.0f, 0.0f, (float)texture->GetWidth(), (float)texture->GetHeight());
+
+    // Границы трех столбцов и трех строк в текстуре и на экране.
+    float srcX[4] = { src.min_.x_, src.min_.x_ + border.left_, src.max_.x_ - border.right_, src.max_.x_ };
+    float srcY[4] = { src.min_.y_, src.min_.y_ + border.top_, src.max_.y_ - border.bottom_, src.max_.y_ };
+
+    // Если края не помещаются в destination, то они пропорционально уменьшаются,
+    // иначе углы перекрылись бы и вылезли за его пределы.
+    float left = (float)border.left_;
+    float right = (float)border.right_;
+    float top = (float)border.top_;
+    float bottom = (float)border.bottom_;
+
+    float width = Max(destination.max_.x_ - destination.min_.x_, 0.0f);
+    if (left + right > width)
+    {
+        float factor = width / (left + right);
+        left *= factor;
+        right *= factor;
+    }
+
+    float height = Max(destination.max_.y_ - destination.min_.y_, 0.0f);
+    if (top + bottom > height)
+    {
+        float factor = height / (top + bottom);
+        top *= factor;
+        bottom *= factor;
+    }
+
+    float destX[4] = { destination.min_.x_, destination.min_.x_ + left, destination.max_.x_ - right, destination.max_.x_ };
+    float destY[4] = { destination.min_.y_, destination.min_.y_ + top, destination.max_.y_ - bottom, destination.max_.y_ };
+
+    for (unsigned y = 0; y < 3; y++)
+    {
+        for (unsigned x = 0; x < 3; x++)
+        {
+            // Пропускаем пустые части (например, если края нулевой толщины).
+            if (destX[x + 1] <= destX[x] || destY[y + 1] <= destY[y])
+                continue;
+
+            Rect part(srcX[x], srcY[y], srcX[x + 1], srcY[y + 1]);
+            Draw(texture, Rect(destX[x], destY[y], destX[x + 1], destY[y + 1]), &part, color);
+        }
+    }
+}
+
 void SpriteBatch::End()
 {
+    if (captureBatch_)
+    {
+        captureBuffer_.WriteUByte(SBC_END);
+        captureBatch_ = false;
+
+        // Весь пакет пишется в файл одним вызовом.
+        captureFile_->Write(captureBuffer_.GetData(), captureBuffer_.GetSize());
+        captureBuffer_.Clear();
+    }
+
     // Список спрайтов пуст.
     if (sprites_.Size() == 0)
         return;
 
+    // Без графической подсистемы только генерируем вершины.
+    if (!graphics_)
+    {
+        unsigned startSpriteIndex = 0;
+        while (startSpriteIndex != sprites_.Size())
+        {
+            SBPortionClass portionClass;
+            unsigned count = GetPortionLength(startSpriteIndex, portionClass);
+            RenderPortion(startSpriteIndex, count, portionClass);
+            startSpriteIndex += count;
+        }
+        return;
+    }
+
+    // Встроенная белая текстура создана вручную, поэтому при потере устройства
+    // она не перезагружается из кэша, и ее нужно заполнить заново.
+    if (defaultWhiteTexture_->IsDataLost())
+        UploadWhiteTexture();
+
     graphics_->ResetRenderTargets();
     graphics_->ClearParameterSources();
     graphics_->SetCullMode(CULL_NONE);
     graphics_->SetDepthTest(compareMode_);
-    graphics_->SetBlendMode(blendMode_);
     graphics_->SetDepthWrite(false);
     graphics_->SetStencilTest(false);
     graphics_->SetScissorTest(false);
     graphics_->SetColorWrite(true);
     graphics_->SetIndexBuffer(indexBuffer_);
     graphics_->SetVertexBuffer(vertexBuffer_);
-    graphics_->SetViewport(viewportRect_);
 
+    if (useRenderTexture_)
+        BeginRenderTexture();
+    else
+        graphics_->SetViewport(viewportRect_);
+
+    // Порядок спрайтов менять нельзя (они могут перекрываться), поэтому порции идут
+    // в порядке вызовов Draw(), а между порциями меняется только то, что отличается.
+    const SBSprite* prevPortion = nullptr;
     unsigned startSpriteIndex = 0;
     while (startSpriteIndex != sprites_.Size())
     {
-        unsigned count = GetPortionLength(startSpriteIndex);
-        RenderPortion(startSpriteIndex, count);
+        SBPortionClass portionClass;
+        unsigned count = GetPortionLength(startSpriteIndex, portionClass);
+        ApplyPortionState(sprites_[startSpriteIndex], prevPortion);
+        RenderPortion(startSpriteIndex, count, portionClass);
+        prevPortion = &sprites_[startSpriteIndex];
         startSpriteIndex += count;
     }
+
+    if (useRenderTexture_)
+        BlitRenderTexture();
+}
+
+IntVector2 SpriteBatch::GetRenderTextureSize()
+{
+    return IntVector2(Max((int)(virtualScreenSize_.x_ * renderTextureScale_ + 0.5f), 1),
+                      Max((int)(virtualScreenSize_.y_ * renderTextureScale_ + 0.5f), 1));
+}
+
+void SpriteBatch::BeginRenderTexture()
+{
+    IntVector2 size = GetRenderTextureSize();
+
+    if (!renderTexture_ || renderTexture_->GetWidth() != size.x_ || renderTexture_->GetHeight() != size.y_)
+    {
+        renderTexture_ = new Texture2D(context_);
+        renderTexture_->SetNumLevels(1);
+        renderTexture_->SetAddressMode(COORD_U, ADDRESS_CLAMP);
+        renderTexture_->SetAddressMode(COORD_V, ADDRESS_CLAMP);
+        renderTexture_->SetSize(size.x_, size.y_, Graphics::GetRGBAFormat(), TEXTURE_RENDERTARGET);
+    }
+    renderTexture_->SetFilterMode(renderTextureFilter_);
+
+    graphics_->SetRenderTarget(0, renderTexture_);
+
+    // Буфер глубины не используется, но его размер должен подходить к размеру текстуры.
+    Renderer* renderer = GetSubsystem<Renderer>();
+    if (renderer)
+        graphics_->SetDepthStencil(renderer->GetDepthStencil(size.x_, size.y_, 1, false));
+
+    graphics_->SetViewport(IntRect(0, 0, size.x_, size.y_));
+    graphics_->Clear(CLEAR_COLOR, renderTextureBackground_);
+}
+
+void SpriteBatch::BlitRenderTexture()
+{
+    graphics_->ResetRenderTargets();
+    graphics_->SetViewport(viewportRect_);
+
+    // С непрозрачным фоном текстура уже содержит итоговое изображение.
+    // С прозрачным фоном наложение приблизительное (см. renderTextureBackground_).
+    if (renderTextureBackground_.a_ >= 1.0f)
+        graphics_->SetBlendMode(BLEND_REPLACE);
+    else
+        graphics_->SetBlendMode(BLEND_PREMULALPHA);
+
+    // Прямоугольник сразу задается в координатах [-1, 1], поэтому матрица единичная.
+    // Чтобы параметры не совпали с параметрами спрайтов, источником указывается текстура.
+    graphics_->SetShaders(spriteVS_, spritePS_);
+    if (graphics_->NeedParameterUpdate(SP_OBJECT, renderTexture_.Get()))
+        graphics_->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
+    if (graphics_->NeedParameterUpdate(SP_CAMERA, renderTexture_.Get()))
+        graphics_->SetShaderParameter(VSP_VIEWPROJ, Matrix4::IDENTITY);
+    if (graphics_->NeedParameterUpdate(SP_MATERIAL, renderTexture_.Get()))
+        graphics_->SetShaderParameter(PSP_MATDIFFCOLOR, Color(1.0f, 1.0f, 1.0f, 1.0f));
+
+    // Смещение на пол пикселя для DirectX 9 (см. GetViewProjMatrix()).
+    Vector2 offset = Graphics::GetPixelUVOffset();
+    offset.x_ *= 2.0f / viewportRect_.Width();
+    offset.y_ *= 2.0f / viewportRect_.Height();
+
+    float top = 0.0f;
+    float bottom = 1.0f;
+#ifdef URHO3D_OPENGL
+    // В OpenGL текстура, в которую рендерили, перевернута по вертикали.
+    top = 1.0f;
+    bottom = 0.0f;
+#endif
+
+    unsigned color = Color::WHITE.ToUInt();
+    SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(0, VERTICES_PER_SPRITE, true);
+    vertices[0] = { Vector3(-1.0f - offset.x_,  1.0f + offset.y_, 0.0f), color, Vector2(0.0f, top) };
+    vertices[1] = { Vector3( 1.0f - offset.x_,  1.0f + offset.y_, 0.0f), color, Vector2(1.0f, top) };
+    vertices[2] = { Vector3( 1.0f - offset.x_, -1.0f + offset.y_, 0.0f), color, Vector2(1.0f, bottom) };
+    vertices[3] = { Vector3(-1.0f - offset.x_, -1.0f + offset.y_, 0.0f), color, Vector2(0.0f, bottom) };
+    vertexBuffer_->Unlock();
+
+    graphics_->SetTexture(TU_DIFFUSE, renderTexture_);
+    graphics_->Draw(TRIANGLE_LIST, 0, INDICES_PER_SPRITE, 0, VERTICES_PER_SPRITE);
 }
 
 Vector2 SpriteBatch::GetVirtualPos(const Vector2& realPos)
 {
-    if (virtualScreenSize_.x_ <= 0 || virtualScreenSize_.x_ <= 0)
+    // Работает и при рендеринге в текстуру, так как viewportRect_ всегда задает область окна.
+    if (virtualScreenSize_.x_ <= 0 || virtualScreenSize_.y_ <= 0)
         return realPos;
 
     float factor = (float)virtualScreenSize_.x_ / viewportRect_.Width();
@@ -269,21 +738,33 @@ Matrix4 SpriteBatch::GetViewProjMatrix()
     if (camera_)
         return camera_->GetGPUProjection() * camera_->GetView();
 
+    if (useReplayViewProj_)
+        return replayViewProj_;
+
     int w = virtualScreenSize_.x_;
     int h = virtualScreenSize_.y_;
 
     // Размеры виртуального экрана не заданы.
     if (w <= 0 || h <= 0)
     {
-        w = graphics_->GetWidth();
-        h = graphics_->GetHeight();
+        w = screenSize_.x_;
+        h = screenSize_.y_;
     }
 
     // В DirectX 9 вершины нужно смещать на пол пикселя
     // http://drilian.com/2008/11/25/understanding-half-pixel-and-half-texel-offsets/
     float pixelWidth  = 2.0f / w; // Двойка так как длина отрезка [-1, 1] равна двум.
     float pixelHeight = 2.0f / h; // Подробности: https://github.com/1vanK/Urho3DTutor01 .
-    Vector2 offset = graphics_->GetPixelUVOffset(); // Возвращает (0.5f, 0.5f) для DirectX 9 и (0.0f, 0.0f) в остальных случаях.
+
+    // При рендеринге в текстуру смещение задается в пикселях текстуры.
+    if (useRenderTexture_)
+    {
+        IntVector2 size = GetRenderTextureSize();
+        pixelWidth = 2.0f / size.x_;
+        pixelHeight = 2.0f / size.y_;
+    }
+
+    Vector2 offset = Graphics::GetPixelUVOffset(); // Возвращает (0.5f, 0.5f) для DirectX 9 и (0.0f, 0.0f) в остальных случаях.
     offset.x_ *= pixelWidth;
     offset.y_ *= pixelHeight;
 
@@ -293,8 +774,14 @@ Matrix4 SpriteBatch::GetViewProjMatrix()
                    0.0f,        0.0f,         0.0f,    1.0f);
 }
 
-unsigned SpriteBatch::GetPortionLength(unsigned start)
+unsigned SpriteBatch::GetPortionLength(unsigned start, SBPortionClass& portionClass)
 {
+    const SBSprite& first = sprites_[start];
+    bool hasAxisAligned = !first.transformed_;
+    bool hasTransformed = first.transformed_;
+    bool hasFlip = first.effects_ != SBE_NONE;
+    bool uniformColor = true;
+
     unsigned count = 1;
 
     while (true)
@@ -318,40 +805,84 @@ unsigned SpriteBatch::GetPortionLength(unsigned start)
         if (sprites_[nextSpriteIndex].pixelShader_ != sprites_[start].pixelShader_)
             break;
 
+        if (sprites_[nextSpriteIndex].blendMode_ != sprites_[start].blendMode_)
+            break;
+
+        if (sprites_[nextSpriteIndex].renderState_ != sprites_[start].renderState_)
+            break;
+
+        // Спрайт попадает в порцию. Уточняем ее класс.
+        const SBSprite& next = sprites_[nextSpriteIndex];
+        hasAxisAligned = hasAxisAligned || !next.transformed_;
+        hasTransformed = hasTransformed || next.transformed_;
+        hasFlip = hasFlip || next.effects_ != SBE_NONE;
+        uniformColor = uniformColor && next.color_ == first.color_;
+
         count++;
     }
 
+    portionClass.transform_ = !hasTransformed ? SBPT_AXIS_ALIGNED : (hasAxisAligned ? SBPT_MIXED : SBPT_TRANSFORMED);
+    portionClass.flip_ = hasFlip;
+    portionClass.uniformColor_ = uniformColor;
+
     return count;
 }
 
-// Никакие проверки не производятся, все входные данные должны быть корректными.
-void SpriteBatch::RenderPortion(unsigned start, unsigned count)
+void SpriteBatch::ApplyPortionState(const SBSprite& sprite, const SBSprite* prev)
 {
-    graphics_->SetShaders(sprites_[start].vertexShader_, sprites_[start].pixelShader_);
-    if (graphics_->NeedParameterUpdate(SP_OBJECT, this))
-        graphics_->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
-    if (graphics_->NeedParameterUpdate(SP_CAMERA, this))
-        graphics_->SetShaderParameter(VSP_VIEWPROJ, GetViewProjMatrix());
-    if (graphics_->NeedParameterUpdate(SP_MATERIAL, this))
-        graphics_->SetShaderParameter(PSP_MATDIFFCOLOR, Color(1.0f, 1.0f, 1.0f, 1.0f));
+    if (!prev || prev->blendMode_ != sprite.blendMode_)
+        graphics_->SetBlendMode(sprite.blendMode_);
+
+    if (!prev || prev->vertexShader_ != sprite.vertexShader_ || prev->pixelShader_ != sprite.pixelShader_)
+    {
+        // Параметры хранятся в шейдерной программе, поэтому их нужно проверять только после смены шейдеров.
+        graphics_->SetShaders(sprite.vertexShader_, sprite.pixelShader_);
+        if (graphics_->NeedParameterUpdate(SP_OBJECT, this))
+            graphics_->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
+        if (graphics_->NeedParameterUpdate(SP_CAMERA, this))
+            graphics_->SetShaderParameter(VSP_VIEWPROJ, GetViewProjMatrix());
+        if (graphics_->NeedParameterUpdate(SP_MATERIAL, this))
+            graphics_->SetShaderParameter(PSP_MATDIFFCOLOR, Color(1.0f, 1.0f, 1.0f, 1.0f));
+    }
+
+    if (!prev || prev->texture_ != sprite.texture_)
+        graphics_->SetTexture(TU_DIFFUSE, sprite.texture_);
+
+    if (!prev || prev->renderState_ != sprite.renderState_)
+    {
+        const SBRenderState& state = GetRenderState(sprite.renderState_);
+        const SBRenderState* prevState = prev ? &GetRenderState(prev->renderState_) : nullptr;
+
+        for (unsigned i = TU_DIFFUSE + 1; i < MAX_MATERIAL_TEXTURE_UNITS; i++)
+        {
+            if (!prevState || prevState->textures_[i] != state.textures_[i])
+                graphics_->SetTexture(i, state.textures_[i]);
+        }
+    }
+}
+
+// Параметры шаблона известны при компиляции, поэтому лишние ветки удаляются компилятором.
+template <int portionTransform, bool flip, bool uniformColor>
+void SpriteBatch::WritePortionVertices(const SBSprite* sprites, unsigned count, SBVertex* vertices, float z)
+{
+    unsigned color = sprites[0].color_;
 
-    Texture2D* texture = sprites_[start].texture_;
-    
-    SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(0, count * VERTICES_PER_SPRITE, true);
-    float invw = 1.0f / texture->GetWidth();
-    float invh = 1.0f / texture->GetHeight();
     for (unsigned i = 0; i < count; i++)
     {
-        SBSprite* sprite = &sprites_[i + start];
-        unsigned color = sprite->color_.ToUInt();
+        const SBSprite* sprite = &sprites[i];
         Rect dest = sprite->destination_;
         Rect src = sprite->source_;
         Vector2 origin = sprite->origin_;
-        SBEffects effects = sprite->effects_;
         Vector2 scale = sprite->scale_;
 
+        if (!uniformColor)
+            color = sprite->color_;
+
+        bool axisAligned = portionTransform == SBPT_AXIS_ALIGNED ||
+            (portionTransform == SBPT_MIXED && !sprite->transformed_);
+
         // Если спрайт не повернут и не отмаcштабирован, то прорисовка очень проста.
-        if (sprite->rotation_ == 0.0f && sprite->scale_ == Vector2::ONE)
+        if (axisAligned)
         {
             // Сдвигаем спрайт на -origin.
             dest.min_ -= origin;
@@ -359,10 +890,10 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
 
             // Лицевая грань задается по часовой стрелке. Учитываем, что ось Y направлена вниз.
             // Но нет большой разницы, так как спрайты двусторонние.
-            vertices[i * VERTICES_PER_SPRITE + 0].position_ = Vector3(dest.min_.x_, dest.min_.y_, z_); // Верхний левый угол спрайта.
-            vertices[i * VERTICES_PER_SPRITE + 1].position_ = Vector3(dest.max_.x_, dest.min_.y_, z_); // Правый верхний угол.
-            vertices[i * VERTICES_PER_SPRITE + 2].position_ = Vector3(dest.max_.x_, dest.max_.y_, z_); // Нижний правый угол.
-            vertices[i * VERTICES_PER_SPRITE + 3].position_ = Vector3(dest.min_.x_, dest.max_.y_, z_); // Левый нижний угол.
+            vertices[i * VERTICES_PER_SPRITE + 0].position_ = Vector3(dest.min_.x_, dest.min_.y_, z); // Верхний левый угол спрайта.
+            vertices[i * VERTICES_PER_SPRITE + 1].position_ = Vector3(dest.max_.x_, dest.min_.y_, z); // Правый верхний угол.
+            vertices[i * VERTICES_PER_SPRITE + 2].position_ = Vector3(dest.max_.x_, dest.max_.y_, z); // Нижний правый угол.
+            vertices[i * VERTICES_PER_SPRITE + 3].position_ = Vector3(dest.min_.x_, dest.max_.y_, z); // Левый нижний угол.
         }
         else
         {
@@ -387,22 +918,22 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
             // В движке вектор умножается на матрицу справа (в отличие от шейдеров). Вычисления в однородных координатах.
             Vector3 v0(local.min_.x_, local.min_.y_, 1.0f); // Верхний левый угол спрайта.
             v0 = transform * v0;
-            v0.z_ = z_;
+            v0.z_ = z;
             vertices[i * VERTICES_PER_SPRITE + 0].position_ = v0;
 
             Vector3 v1(local.max_.x_, local.min_.y_, 1.0f); // Правый верхний угол.
             v1 = transform * v1;
-            v1.z_ = z_;
+            v1.z_ = z;
             vertices[i * VERTICES_PER_SPRITE + 1].position_ = v1;
 
             Vector3 v2(local.max_.x_, local.max_.y_, 1.0f); // Нижний правый угол.
             v2 = transform * v2;
-            v2.z_ = z_;
+            v2.z_ = z;
             vertices[i * VERTICES_PER_SPRITE + 2].position_ = v2;
 
             Vector3 v3(local.min_.x_, local.max_.y_, 1.0f); // Левый нижний угол.
             v3 = transform * v3;
-            v3.z_ = z_;
+            v3.z_ = z;
             vertices[i * VERTICES_PER_SPRITE + 3].position_ = v3;
         }
 
@@ -411,29 +942,326 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
         vertices[i * VERTICES_PER_SPRITE + 2].color_ = color;
         vertices[i * VERTICES_PER_SPRITE + 3].color_ = color;
 
-        if (effects & SBE_FLIP_HORIZONTALLY)
+        if (flip)
         {
-            float tmp = src.min_.x_;
-            src.min_.x_ = src.max_.x_;
-            src.max_.x_ = tmp;
+            // Края выбираются по битам отражения, без ветвлений.
+            float x[2] = { src.min_.x_, src.max_.x_ };
+            float y[2] = { src.min_.y_, src.max_.y_ };
+            unsigned flipX = sprite->effects_ & SBE_FLIP_HORIZONTALLY;
+            unsigned flipY = (sprite->effects_ & SBE_FLIP_VERTICALLY) >> 1;
+            src = Rect(x[flipX], y[flipY], x[1 - flipX], y[1 - flipY]);
         }
 
-        if (effects & SBE_FLIP_VERTICALLY)
+        vertices[i * VERTICES_PER_SPRITE + 0].uv_ = Vector2(src.min_.x_, src.min_.y_);
+        vertices[i * VERTICES_PER_SPRITE + 1].uv_ = Vector2(src.max_.x_, src.min_.y_);
+        vertices[i * VERTICES_PER_SPRITE + 2].uv_ = Vector2(src.max_.x_, src.max_.y_);
+        vertices[i * VERTICES_PER_SPRITE + 3].uv_ = Vector2(src.min_.x_, src.max_.y_);
+    }
+}
+
+// Никакие проверки не производятся, все входные данные должны быть корректными.
+void SpriteBatch::RenderPortion(unsigned start, unsigned count, const SBPortionClass& portionClass)
+{
+    // Специализации WritePortionVertices() для всех классов порций: [portionTransform][flip][uniformColor].
+    static const WritePortionVerticesFunc kernels[3][2][2] =
+    {
+        {
+            { &WritePortionVertices<SBPT_AXIS_ALIGNED, false, false>, &WritePortionVertices<SBPT_AXIS_ALIGNED, false, true> },
+            { &WritePortionVertices<SBPT_AXIS_ALIGNED, true, false>, &WritePortionVertices<SBPT_AXIS_ALIGNED, true, true> }
+        },
+        {
+            { &WritePortionVertices<SBPT_TRANSFORMED, false, false>, &WritePortionVertices<SBPT_TRANSFORMED, false, true> },
+            { &WritePortionVertices<SBPT_TRANSFORMED, true, false>, &WritePortionVertices<SBPT_TRANSFORMED, true, true> }
+        },
         {
-            float tmp = src.min_.y_;
-            src.min_.y_ = src.max_.y_;
-            src.max_.y_ = tmp;
+            { &WritePortionVertices<SBPT_MIXED, false, false>, &WritePortionVertices<SBPT_MIXED, false, true> },
+            { &WritePortionVertices<SBPT_MIXED, true, false>, &WritePortionVertices<SBPT_MIXED, true, true> }
         }
+    };
 
-        vertices[i * VERTICES_PER_SPRITE + 0].uv_ = Vector2(src.min_.x_ * invw, src.min_.y_ * invh);
-        vertices[i * VERTICES_PER_SPRITE + 1].uv_ = Vector2(src.max_.x_ * invw, src.min_.y_ * invh);
-        vertices[i * VERTICES_PER_SPRITE + 2].uv_ = Vector2(src.max_.x_ * invw, src.max_.y_ * invh);
-        vertices[i * VERTICES_PER_SPRITE + 3].uv_ = Vector2(src.min_.x_ * invw, src.max_.y_ * invh);
-    }
+    const SBSprite* sprites = &sprites_[start];
+
+    SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(0, count * VERTICES_PER_SPRITE, true);
+    kernels[portionClass.transform_][portionClass.flip_][portionClass.uniformColor_](sprites, count, vertices, z_);
     vertexBuffer_->Unlock();
-    
-    graphics_->SetTexture(0, texture);
-    graphics_->Draw(TRIANGLE_LIST, 0, count * INDICES_PER_SPRITE, 0, count * VERTICES_PER_SPRITE);
+
+    if (graphics_)
+        graphics_->Draw(TRIANGLE_LIST, 0, count * INDICES_PER_SPRITE, 0, count * VERTICES_PER_SPRITE);
+}
+
+bool SpriteBatch::StartCapture(const String& fileName)
+{
+    StopCapture();
+
+    SharedPtr<File> file(new File(context_, fileName, FILE_WRITE));
+    if (!file->IsOpen())
+        return false;
+
+    file->WriteFileID(CAPTURE_FILE_ID);
+    file->WriteUInt(CAPTURE_VERSION);
+
+    captureFile_ = file;
+    captureTimer_.Reset();
+    captureFramePending_ = true;
+    captureFrameTime_ = 0;
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(SpriteBatch, HandleBeginFrame));
+
+    return true;
+}
+
+void SpriteBatch::StopCapture()
+{
+    if (!captureFile_)
+        return;
+
+    UnsubscribeFromEvent(E_BEGINFRAME);
+
+    // Незавершенный пакет (запись остановлена между Begin() и End()) в файл не попадает.
+    captureBatch_ = false;
+    captureBuffer_.Clear();
+    captureFile_->Close();
+    captureFile_.Reset();
+    captureTextures_.Clear();
+    captureFonts_.Clear();
+    captureRenderStates_.Clear();
+}
+
+void SpriteBatch::HandleBeginFrame(StringHash eventType, VariantMap& eventData)
+{
+    captureFramePending_ = true;
+    captureFrameTime_ = captureTimer_.GetMSec(false);
+}
+
+void SpriteBatch::CaptureFrameStart()
+{
+    if (!captureFramePending_)
+        return;
+
+    captureBuffer_.WriteUByte(SBC_FRAME);
+    captureBuffer_.WriteUInt(captureFrameTime_);
+    captureFramePending_ = false;
+}
+
+unsigned SpriteBatch::CaptureTexture(Texture2D* texture)
+{
+    HashMap<Texture2D*, unsigned>::ConstIterator it = captureTextures_.Find(texture);
+    if (it != captureTextures_.End())
+        return it->second_;
+
+    unsigned id = captureTextures_.Size();
+    captureTextures_[texture] = id;
+
+    captureBuffer_.WriteUByte(SBC_TEXTURE);
+    captureBuffer_.WriteString(texture->GetName());
+    captureBuffer_.WriteIntVector2(IntVector2(texture->GetWidth(), texture->GetHeight()));
+
+    return id;
+}
+
+unsigned SpriteBatch::CaptureFont(Font* font)
+{
+    HashMap<Font*, unsigned>::ConstIterator it = captureFonts_.Find(font);
+    if (it != captureFonts_.End())
+        return it->second_;
+
+    unsigned id = captureFonts_.Size();
+    captureFonts_[font] = id;
+
+    captureBuffer_.WriteUByte(SBC_FONT);
+    captureBuffer_.WriteString(font->GetName());
+
+    return id;
+}
+
+void SpriteBatch::CaptureRenderState(unsigned renderState)
+{
+    if (renderState == SB_DEFAULT_RENDER_STATE || captureRenderStates_.Contains(renderState))
+        return;
+
+    captureRenderStates_.Insert(renderState);
+
+    const SBRenderState& state = GetRenderState(renderState);
+    captureBuffer_.WriteUByte(SBC_RENDER_STATE);
+    captureBuffer_.WriteVLE(renderState);
+    captureBuffer_.WriteUByte((unsigned char)state.blendMode_);
+    captureBuffer_.WriteString(state.vertexShader_ ? state.vertexShader_->GetName() : String::EMPTY);
+    captureBuffer_.WriteString(state.vertexShader_ ? state.vertexShader_->GetDefines() : String::EMPTY);
+    captureBuffer_.WriteString(state.pixelShader_ ? state.pixelShader_->GetName() : String::EMPTY);
+    captureBuffer_.WriteString(state.pixelShader_ ? state.pixelShader_->GetDefines() : String::EMPTY);
+    for (unsigned i = TU_DIFFUSE + 1; i < MAX_MATERIAL_TEXTURE_UNITS; i++)
+        captureBuffer_.WriteString(state.textures_[i] ? state.textures_[i]->GetName() : String::EMPTY);
+}
+
+SharedPtr<Texture2D> SpriteBatch::GetReplayTexture(const String& name, const IntVector2& size)
+{
+    if (name == WHITE_TEXTURE_NAME)
+        return defaultWhiteTexture_;
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    SharedPtr<Texture2D> texture;
+    if (!name.Empty())
+        texture = cache->GetResource<Texture2D>(name);
+
+    // Для генерации вершин важен только размер текстуры.
+    if (!texture || texture->GetWidth() != size.x_ || texture->GetHeight() != size.y_)
+    {
+        texture = new Texture2D(context_);
+        texture->SetSize(size.x_, size.y_, Graphics::GetRGBAFormat());
+    }
+
+    return texture;
+}
+
+bool SpriteBatch::ReplayFrame(Deserializer& source, unsigned* timeStamp)
+{
+    // Начало файла.
+    if (source.GetPosition() == 0)
+    {
+        if (source.ReadFileID() != CAPTURE_FILE_ID || source.ReadUInt() != CAPTURE_VERSION)
+        {
+            URHO3D_LOGERROR(source.GetName() + " is not a supported sprite batch capture");
+            return false;
+        }
+
+        replayTextures_.Clear();
+        replayFonts_.Clear();
+        replayRenderStates_.Clear();
+
+        // Состояния из предыдущего воспроизведения больше не нужны. Без этого каждый
+        // проход по файлу добавлял бы новые копии всех состояний.
+        replayStates_.Clear();
+    }
+
+    if (source.IsEof() || source.ReadUByte() != SBC_FRAME)
+        return false;
+
+    unsigned frameTime = source.ReadUInt();
+    if (timeStamp)
+        *timeStamp = frameTime;
+
+    while (!source.IsEof())
+    {
+        unsigned commandPosition = source.GetPosition();
+        unsigned char command = source.ReadUByte();
+
+        switch (command)
+        {
+        case SBC_FRAME:
+            // Следующий кадр будет прочитан при следующем вызове.
+            source.Seek(commandPosition);
+            return true;
+
+        case SBC_BEGIN:
+        {
+            BlendMode blendMode = (BlendMode)source.ReadUByte();
+            CompareMode compareMode = (CompareMode)source.ReadUByte();
+            float z = source.ReadFloat();
+            virtualScreenSize_ = source.ReadIntVector2();
+            IntVector2 screenSize = source.ReadIntVector2();
+            bool hasCamera = source.ReadBool();
+            Matrix4 viewProj = hasCamera ? source.ReadMatrix4() : Matrix4::IDENTITY;
+
+            // С графической подсистемой используется размер реального окна.
+            if (!graphics_)
+                screenSize_ = screenSize;
+
+            Begin(blendMode, compareMode, z);
+
+            useReplayViewProj_ = hasCamera;
+            replayViewProj_ = viewProj;
+            break;
+        }
+
+        case SBC_DRAW:
+        {
+            unsigned textureId = source.ReadVLE();
+            Rect destination = source.ReadRect();
+            Rect sourceRect = source.ReadRect();
+            Color color;
+            color.FromUInt(source.ReadUInt());
+            float rotation = source.ReadFloat();
+            Vector2 origin = source.ReadVector2();
+            Vector2 scale = source.ReadVector2();
+            SBEffects effects = (SBEffects)source.ReadUByte();
+            unsigned renderState = replayRenderStates_[source.ReadVLE()];
+
+            if (textureId >= replayTextures_.Size())
+                return false;
+
+            Draw(replayTextures_[textureId], destination, &sourceRect, color, rotation, origin, scale, effects, renderState);
+            break;
+        }
+
+        case SBC_DRAW_STRING:
+        {
+            String text = source.ReadString();
+            unsigned fontId = source.ReadVLE();
+            float fontSize = source.ReadFloat();
+            Vector2 position = source.ReadVector2();
+            Color color;
+            color.FromUInt(source.ReadUInt());
+            float rotation = source.ReadFloat();
+            Vector2 origin = source.ReadVector2();
+            Vector2 scale = source.ReadVector2();
+            SBEffects effects = (SBEffects)source.ReadUByte();
+            unsigned renderState = replayRenderStates_[source.ReadVLE()];
+
+            if (fontId >= replayFonts_.Size())
+                return false;
+
+            // Шрифт мог не загрузиться.
+            if (replayFonts_[fontId])
+                DrawString(text, replayFonts_[fontId], fontSize, position, color, rotation, origin, scale, effects, renderState);
+            break;
+        }
+
+        case SBC_END:
+            End();
+            break;
+
+        case SBC_TEXTURE:
+        {
+            String name = source.ReadString();
+            IntVector2 size = source.ReadIntVector2();
+            replayTextures_.Push(GetReplayTexture(name, size));
+            break;
+        }
+
+        case SBC_FONT:
+            replayFonts_.Push(SharedPtr<Font>(GetSubsystem<ResourceCache>()->GetResource<Font>(source.ReadString())));
+            break;
+
+        case SBC_RENDER_STATE:
+        {
+            unsigned capturedState = source.ReadVLE();
+            SBRenderState state;
+            state.blendMode_ = (BlendMode)source.ReadUByte();
+            String vsName = source.ReadString();
+            String vsDefines = source.ReadString();
+            String psName = source.ReadString();
+            String psDefines = source.ReadString();
+            if (graphics_ && !vsName.Empty())
+                state.vertexShader_ = graphics_->GetShader(VS, vsName, vsDefines);
+            if (graphics_ && !psName.Empty())
+                state.pixelShader_ = graphics_->GetShader(PS, psName, psDefines);
+            for (unsigned i = TU_DIFFUSE + 1; i < MAX_MATERIAL_TEXTURE_UNITS; i++)
+            {
+                String textureName = source.ReadString();
+                if (!textureName.Empty())
+                    state.textures_[i] = GetSubsystem<ResourceCache>()->GetResource<Texture2D>(textureName);
+            }
+            replayStates_.Push(state);
+            replayRenderStates_[capturedState] = SB_REPLAY_RENDER_STATE_BASE + replayStates_.Size() - 1;
+            break;
+        }
+
+        default:
+            URHO3D_LOGERROR(source.GetName() + " is corrupted");
+            return false;
+        }
+    }
+
+    return true;
 }
 
 }
\ No newline at end of file
@@ -14,25 +14,36 @@
     Если использовать E_ENDRENDERING, то SpriteBatch будет рисоваться поверх UI.
     Пригодится, например, для вывода курсора.
 
+    Команды можно записать в файл (StartCapture()) и потом воспроизвести
+    без игры с помощью SpriteReplay (см. SpriteReplay.cpp).
+
     Чтобы лучше понимать код, изучите https://github.com/1vanK/Urho3DTutor01 .
 */
 
 #pragma once
 
+#include <Urho3D/Container/HashSet.h>
 #include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Graphics/GraphicsDefs.h>
+#include <Urho3D/Graphics/Texture.h>
 #include <Urho3D/Graphics/ShaderVariation.h>
+#include <Urho3D/IO/VectorBuffer.h>
 
 using namespace Urho3D;
 
 namespace Urho3D
 {
 
+class Deserializer;
+class File;
 class IndexBuffer;
 class Font;
 class Texture2D;
 class Camera;
+class SBSpriteSheet;
 class VertexBuffer;
+struct SBVertex;
 
 // Режимы зеркального отображения спрайтов.
 enum SBEffects
@@ -50,6 +61,31 @@ enum SBEffects
     SBE_FLIP_BOTH = SBE_FLIP_HORIZONTALLY | SBE_FLIP_VERTICALLY,
 };
 
+// Состояние рендеринга, которое можно указать для отдельного спрайта.
+// Регистрируется один раз через AddRenderState(), а затем передается в Draw() по дескриптору.
+struct SBRenderState
+{
+    // Режим наложения.
+    BlendMode blendMode_ = BLEND_ALPHA;
+
+    // Если шейдеры не заданы, то используются стандартные шейдеры для спрайтов или текста.
+    // Как и текстуры, шейдеры удерживаются состоянием.
+    SharedPtr<ShaderVariation> vertexShader_;
+    SharedPtr<ShaderVariation> pixelShader_;
+
+    // Дополнительные текстуры. Элемент TU_DIFFUSE игнорируется, так как
+    // в этот слот всегда попадает текстура самого спрайта. Состояние удерживает
+    // текстуры, поэтому они не будут выгружены, пока существует SpriteBatch.
+    SharedPtr<Texture> textures_[MAX_MATERIAL_TEXTURE_UNITS];
+};
+
+// Дескриптор состояния по умолчанию: режим наложения берется из Begin(), шейдеры стандартные.
+static const unsigned SB_DEFAULT_RENDER_STATE = 0;
+
+// Дескрипторы состояний, созданных при воспроизведении записи, начинаются с этого значения,
+// поэтому не пересекаются с дескрипторами из AddRenderState(). Значение помещается в VLE (29 бит).
+static const unsigned SB_REPLAY_RENDER_STATE_BASE = 0x10000000;
+
 class URHO3D_API SpriteBatch : public Object
 {
     URHO3D_OBJECT(SpriteBatch, Object);
@@ -59,6 +95,29 @@ public:
     // реальные размеры экрана.
     IntVector2 virtualScreenSize_ = IntVector2(0, 0);
 
+    // Если задан виртуальный экран, то спрайты можно рендерить в текстуру с его разрешением,
+    // а потом растягивать ее на вьюпорт одним прямоугольником. Тогда нагрузка на пиксельный
+    // шейдер не зависит от размеров окна (полезно для пиксель-арта). Не используется, если
+    // в Begin() указана камера или режим сравнения глубины, отличный от CMP_ALWAYS.
+    bool renderToTexture_ = false;
+
+    // Разрешение текстуры относительно виртуального экрана.
+    float renderTextureScale_ = 1.0f;
+
+    // Фильтрация при растягивании текстуры на вьюпорт.
+    TextureFilterMode renderTextureFilter_ = FILTER_NEAREST;
+
+    // Фон текстуры виртуального экрана.
+    // Непрозрачный фон (по умолчанию черный): текстура очищается этим цветом и копируется
+    // на экран без смешивания. Результат точный, но то, что было нарисовано под вьюпортом, закрывается.
+    // Прозрачный фон (альфа < 1) нужно включать явно: тогда текстура накладывается поверх сцены
+    // (BLEND_PREMULALPHA), и результат ПРИБЛИЗИТЕЛЬНЫЙ. При BLEND_ALPHA альфа в текстуре
+    // получается равной a * a, поэтому полупрозрачные пиксели (края текста, полупрозрачные спрайты)
+    // пропускают меньше сцены, чем должны. Спрайты с BLEND_ADD, BLEND_MULTIPLY и другими режимами
+    // наложения смешиваются с прозрачным фоном, а не со сценой, поэтому их результат тоже неверен.
+    // Точны только непрозрачные пиксели, нарисованные с BLEND_ALPHA или BLEND_REPLACE.
+    Color renderTextureBackground_ = Color::BLACK;
+
     SpriteBatch(Context *context, unsigned maxPortionSize = 500);
     virtual ~SpriteBatch();
 
@@ -67,34 +126,101 @@ public:
 
     void End();
 
+    // Регистрирует состояние рендеринга и возвращает его дескриптор для функций Draw() и DrawString().
+    // Состояния хранятся все время жизни SpriteBatch, поэтому их нужно создавать один раз, а не каждый кадр.
+    unsigned AddRenderState(const SBRenderState& renderState);
+
     void Draw(Texture2D* texture, const Rect& destination, Rect* source = nullptr, const Color& color = Color::WHITE,
-        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE);
+        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE,
+        unsigned renderState = SB_DEFAULT_RENDER_STATE);
 
     void Draw(Texture2D* texture, const Vector2& position, Rect* source = nullptr, const Color& color = Color::WHITE,
-        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE);
+        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE,
+        unsigned renderState = SB_DEFAULT_RENDER_STATE);
+
+    // Рисует кадр из бинарного атласа (см. SBSpriteSheet). Точка привязки кадра используется как origin.
+    void Draw(SBSpriteSheet* sheet, unsigned frameId, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE,
+        unsigned renderState = SB_DEFAULT_RENDER_STATE);
 
     void DrawString(const String& text, Font* font, float fontSize, const Vector2& position, const Color& color = Color::WHITE,
-        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE);
+        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, const Vector2& scale = Vector2::ONE, SBEffects effects = SBE_NONE,
+        unsigned renderState = SB_DEFAULT_RENDER_STATE);
+
+    // Примитивы рисуются белым пикселем (см. SetWhitePixel()) как обычные спрайты,
+    // поэтому не требуют отдельных вызовов отрисовки.
+    void DrawLine(const Vector2& start, const Vector2& end, const Color& color = Color::WHITE, float thickness = 1.0f);
+
+    void DrawRect(const Rect& rect, const Color& color = Color::WHITE);
+
+    // Рамка рисуется внутри прямоугольника. Толщина ограничивается половиной его ширины и высоты.
+    void DrawRectOutline(const Rect& rect, const Color& color = Color::WHITE, float thickness = 1.0f);
+
+    void DrawCircle(const Vector2& center, float radius, const Color& color = Color::WHITE, float thickness = 1.0f, unsigned segments = 32);
+
+    // Круг составляется из горизонтальных полос высотой не больше stripHeight. По умолчанию
+    // одна полоса на строку пикселей. В мировых координатах (с камерой) высоту нужно уменьшить.
+    void DrawFilledCircle(const Vector2& center, float radius, const Color& color = Color::WHITE, float stripHeight = 1.0f);
+
+    // Растягивает часть текстуры на destination, сохраняя размеры углов. В border задаются
+    // толщины краев в пикселях текстуры (left_, top_, right_, bottom_). Если destination меньше
+    // суммы краев, то края на экране пропорционально уменьшаются.
+    void DrawNineSlice(Texture2D* texture, const Rect& destination, const IntRect& border, Rect* source = nullptr,
+        const Color& color = Color::WHITE);
+
+    // Задает белый пиксель, которым рисуются примитивы. Если взять его из атласа с остальными
+    // спрайтами, то примитивы не будут разбивать порции. nullptr - встроенная текстура 1x1.
+    // SpriteBatch удерживает текстуру, пока не будет задан другой пиксель.
+    void SetWhitePixel(Texture2D* texture = nullptr, const IntVector2& pixel = IntVector2::ZERO);
 
     // Переводит реальные координаты в виртуальные. Используется для курсора мыши.
     Vector2 GetVirtualPos(const Vector2& realPos);
 
+    // Начинает записывать все вызовы Begin(), Draw(), DrawString() и End() в бинарный файл.
+    // Текстуры и шрифты сохраняются по именам ресурсов.
+    bool StartCapture(const String& fileName);
+
+    void StopCapture();
+
+    bool IsCapturing() const { return captureFile_.NotNull(); }
+
+    // Читает из потока один кадр, сохраненный функцией StartCapture(), и выполняет его.
+    // В timeStamp возвращается время начала кадра в миллисекундах от начала записи.
+    // Возвращает false, если кадров больше нет или файл поврежден. Состояния рендеринга из записи
+    // хранятся отдельно от зарегистрированных через AddRenderState() и удаляются, когда поток
+    // начинается заново. Дескрипторы из AddRenderState() при этом остаются действительными.
+    // Работает и без графической подсистемы (-headless): тогда вершины генерируются, но ничего не рисуется,
+    // а текст пропускается (шрифты не загружаются без графической подсистемы).
+    bool ReplayFrame(Deserializer& source, unsigned* timeStamp = nullptr);
+
 protected:
     // Отдельный спрайт в очереди на отрисовку.
     struct SBSprite
     {
         Texture2D* texture_;
         Rect destination_;
+
+        // Область текстуры в текстурных координатах [0, 1].
         Rect source_;
-        Color color_;
+
+        // Цвет упаковывается один раз при добавлении спрайта.
+        unsigned color_;
+
         float rotation_;
         Vector2 origin_;
         Vector2 scale_;
         SBEffects effects_;
 
+        // Спрайт повернут или отмасштабирован. Вычисляется при добавлении спрайта.
+        bool transformed_;
+
         // Для отрисовки текста и обычных спрайтов нужны разные шейдеры.
         ShaderVariation* vertexShader_;
         ShaderVariation* pixelShader_;
+
+        // Режим наложения и дескриптор состояния (нужен для дополнительных текстур).
+        BlendMode blendMode_;
+        unsigned renderState_;
     };
 
     // Размер порции (максимальное число спрайтов, выводимых за один DrawCall).
@@ -109,6 +235,15 @@ protected:
     // Спрайты, которые ожидают рендеринга.
     PODVector<SBSprite> sprites_;
 
+    // Текстура и область для примитивов (в текстурных координатах). Область - центр пикселя,
+    // чтобы при фильтрации не захватывались соседние пиксели атласа.
+    SharedPtr<Texture2D> defaultWhiteTexture_;
+    SharedPtr<Texture2D> whiteTexture_;
+    Rect whiteSource_;
+
+    // Зарегистрированные состояния рендеринга. Нулевой элемент - состояние по умолчанию.
+    Vector<SBRenderState> renderStates_;
+
     // Кэширование часто используемых вещей.
     Graphics* graphics_;
     ShaderVariation* spriteVS_;
@@ -135,16 +270,126 @@ protected:
     // Это значение вычисляется в функции Begin().
     IntRect viewportRect_;
 
+    // Рендерить ли текущий пакет в renderTexture_. Вычисляется в функции Begin().
+    bool useRenderTexture_ = false;
+    SharedPtr<Texture2D> renderTexture_;
+
+    // Размеры экрана. Без графической подсистемы берутся из записи.
+    IntVector2 screenSize_;
+
+    // При воспроизведении записи камеры нет, поэтому используется сохраненная матрица.
+    bool useReplayViewProj_ = false;
+    Matrix4 replayViewProj_;
+
+    // Файл, в который пишутся команды. Если не задан, то запись не ведется.
+    SharedPtr<File> captureFile_;
+    Timer captureTimer_;
+
+    // Команды текущего пакета. Копятся в памяти и пишутся в файл в End(), чтобы запись
+    // не тормозила кадр тысячами мелких обращений к файлу.
+    VectorBuffer captureBuffer_;
+
+    // Запись начинается с ближайшего Begin(), чтобы в файл не попала половина пакета.
+    bool captureBatch_ = false;
+
+    // Кадр еще не записан в файл. Метка кадра пишется только перед первой командой,
+    // чтобы не засорять файл пустыми кадрами.
+    bool captureFramePending_;
+    unsigned captureFrameTime_;
+
+    // Идентификаторы ресурсов, которые уже записаны в файл.
+    HashMap<Texture2D*, unsigned> captureTextures_;
+    HashMap<Font*, unsigned> captureFonts_;
+    HashSet<unsigned> captureRenderStates_;
+
+    // Ресурсы воспроизводимой записи. Индекс - идентификатор из файла.
+    Vector<SharedPtr<Texture2D> > replayTextures_;
+    Vector<SharedPtr<Font> > replayFonts_;
+    HashMap<unsigned, unsigned> replayRenderStates_;
+
+    // Состояния рендеринга из записи. Дескриптор - SB_REPLAY_RENDER_STATE_BASE + индекс.
+    Vector<SBRenderState> replayStates_;
+
+    // Находит состояние по дескриптору.
+    const SBRenderState& GetRenderState(unsigned renderState) const
+    {
+        if (renderState < SB_REPLAY_RENDER_STATE_BASE)
+            return renderStates_[renderState];
+        return replayStates_[renderState - SB_REPLAY_RENDER_STATE_BASE];
+    }
+
+    // Заполняет встроенную белую текстуру (при создании и после потери устройства).
+    void UploadWhiteTexture();
+
+    // Обратные размеры последней использованной текстуры. Почти все спрайты подряд используют
+    // текстуры одного размера, поэтому при переводе области текстуры в текстурные координаты
+    // деление выполняется только при смене размера.
+    IntVector2 invTextureSizeKey_ = IntVector2::ZERO;
+    Vector2 invTextureSize_;
+
+    // Возвращает (1 / ширина, 1 / высота) текстуры.
+    const Vector2& GetInvTextureSize(Texture2D* texture);
+
+    // Добавляет спрайт в очередь. Область текстуры uv задается в текстурных координатах.
+    void PushSprite(Texture2D* texture, const Rect& destination, const Rect& uv, const Color& color,
+        float rotation, const Vector2& origin, const Vector2& scale, SBEffects effects, unsigned renderState);
+
+    // Класс порции. Определяет специализацию WritePortionVertices().
+    struct SBPortionClass
+    {
+        // Значение из SBPortionTransform (см. SpriteBatch.cpp).
+        int transform_;
+
+        // Хотя бы один спрайт отражен.
+        bool flip_;
+
+        // У всех спрайтов один цвет.
+        bool uniformColor_;
+    };
+
     // Рендерит порцию спрайтов, использующих одну и ту же текстуру и шейдер.
-    void RenderPortion(unsigned start, unsigned count);
+    void RenderPortion(unsigned start, unsigned count, const SBPortionClass& portionClass);
+
+    // Генерирует вершины для порции спрайтов. Параметры шаблона задают класс порции
+    // (трансформация, отражение, общий цвет), который определяется в GetPortionLength().
+    template <int portionTransform, bool flip, bool uniformColor>
+    static void WritePortionVertices(const SBSprite* sprites, unsigned count, SBVertex* vertices, float z);
+
+    typedef void (*WritePortionVerticesFunc)(const SBSprite* sprites, unsigned count, SBVertex* vertices, float z);
 
     // Определяет количество спрайтов, которые можно отренедерить без
-    // смены текстуры и шейдера.
-    unsigned GetPortionLength(unsigned start);
+    // смены текстуры, шейдера и остальных состояний. Заодно определяет класс порции,
+    // чтобы не делать для этого отдельный проход по спрайтам.
+    unsigned GetPortionLength(unsigned start, SBPortionClass& portionClass);
+
+    // Применяет состояние порции. Если известна предыдущая порция (prev != nullptr),
+    // то переустанавливается только то, что действительно изменилось.
+    void ApplyPortionState(const SBSprite& sprite, const SBSprite* prev);
 
     // Если определена камера, то спрайты будут отрендерены в мировых координатах,
     // иначе - в экранных.
     Matrix4 GetViewProjMatrix();
+
+    // Размеры renderTexture_ для текущего виртуального экрана.
+    IntVector2 GetRenderTextureSize();
+
+    // Устанавливает renderTexture_ в качестве цели рендеринга (при необходимости пересоздает ее).
+    void BeginRenderTexture();
+
+    // Растягивает renderTexture_ на viewportRect_.
+    void BlitRenderTexture();
+
+    // Функции записи. Идентификаторы ресурсов при необходимости записываются в файл перед командой.
+    void CaptureFrameStart();
+    unsigned CaptureTexture(Texture2D* texture);
+    unsigned CaptureFont(Font* font);
+    void CaptureRenderState(unsigned renderState);
+
+    // Находит текстуру из записи. Если ее нельзя загрузить (например, без графической
+    // подсистемы), то создается пустая текстура того же размера.
+    SharedPtr<Texture2D> GetReplayTexture(const String& name, const IntVector2& size);
+
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+// Воспроизводит запись, сделанную SpriteBatch::StartCapture().
+//
+// SpriteReplay <файл> [-headless] [-paced] [-loops N]
+//
+// -headless  - без окна, только генерация вершин. Удобно для профилирования на любой машине.
+//              Текст при этом НЕ выводится: без графической подсистемы шрифты не создают
+//              текстуры, и Font::GetFace() возвращает nullptr. Поэтому вызовы DrawString()
+//              в измерения не попадают.
+// -paced     - выдерживать время кадров как при записи. По умолчанию кадры идут с максимальной скоростью.
+// -loops N   - сколько раз воспроизвести файл (по умолчанию 1).
+
+#include <Urho3D/Urho3DAll.h>
+#include "SpriteBatch.h"
+
+class SpriteReplay : public Application
+{
+    URHO3D_OBJECT(SpriteReplay, Application);
+
+public:
+    String fileName_;
+    bool paced_ = false;
+    int loops_ = 1;
+
+    SharedPtr<File> file_;
+    SharedPtr<SpriteBatch> spriteBatch_;
+
+    // Время от начала текущего прохода по файлу (для -paced).
+    Timer paceTimer_;
+
+    // Статистика.
+    HiresTimer replayTimer_;
+    long long replayTime_ = 0;
+    unsigned frameCount_ = 0;
+
+    SpriteReplay(Context* context) : Application(context)
+    {
+    }
+
+    void Setup()
+    {
+        const Vector<String>& arguments = GetArguments();
+        for (unsigned i = 0; i < arguments.Size(); i++)
+        {
+            String argument = arguments[i].ToLower();
+
+            if (argument == "-paced")
+                paced_ = true;
+            else if (argument == "-loops" && i + 1 < arguments.Size())
+                loops_ = Max(ToInt(arguments[++i]), 1);
+            else if (!argument.StartsWith("-") && fileName_.Empty())
+                fileName_ = arguments[i];
+        }
+
+        engineParameters_[EP_FULL_SCREEN] = false;
+        engineParameters_[EP_WINDOW_WIDTH] = 800;
+        engineParameters_[EP_WINDOW_HEIGHT] = 600;
+        engineParameters_[EP_FRAME_LIMITER] = false;
+
+        if (fileName_.Empty())
+        {
+            ErrorExit("Usage: SpriteReplay <file> [-headless] [-paced] [-loops N]");
+            return;
+        }
+    }
+
+    void Start()
+    {
+        file_ = new File(context_, fileName_);
+        if (!file_->IsOpen())
+        {
+            ErrorExit("Could not open " + fileName_);
+            return;
+        }
+
+        spriteBatch_ = new SpriteBatch(context_);
+        paceTimer_.Reset();
+
+        // Без окна нет смены кадров движка, поэтому воспроизводим все сразу.
+        if (!GetSubsystem<Graphics>())
+        {
+            PrintLine("Headless replay: DrawString() calls are skipped, text is not included in the timings");
+
+            while (ReplayFrame())
+            {
+            }
+
+            PrintStats();
+            engine_->Exit();
+            return;
+        }
+
+        SubscribeToEvent(E_ENDRENDERING, URHO3D_HANDLER(SpriteReplay, HandleEndRendering));
+    }
+
+    // Воспроизводит следующий кадр. Возвращает false, когда все проходы по файлу закончены.
+    bool ReplayFrame()
+    {
+        while (true)
+        {
+            unsigned position = file_->GetPosition();
+            unsigned timeStamp;
+
+            replayTimer_.Reset();
+            bool replayed = spriteBatch_->ReplayFrame(*file_, &timeStamp);
+            long long time = replayTimer_.GetUSec(false);
+
+            if (replayed)
+            {
+                replayTime_ += time;
+                frameCount_++;
+
+                if (paced_)
+                {
+                    unsigned elapsed = paceTimer_.GetMSec(false);
+                    if (timeStamp > elapsed)
+                        Time::Sleep(timeStamp - elapsed);
+                }
+
+                return true;
+            }
+
+            // Файл пустой или поврежден.
+            if (position == 0 || --loops_ <= 0)
+                return false;
+
+            file_->Seek(0);
+            paceTimer_.Reset();
+        }
+    }
+
+    void PrintStats()
+    {
+        if (!frameCount_)
+        {
+            PrintLine("No frames replayed", true);
+            return;
+        }
+
+        PrintLine("Frames: " + String(frameCount_));
+        PrintLine("Total: " + String(replayTime_ / 1000.0) + " ms");
+        PrintLine("Average: " + String(replayTime_ / 1000.0 / frameCount_) + " ms per frame");
+    }
+
+    void HandleEndRendering(StringHash eventType, VariantMap& eventData)
+    {
+        if (!ReplayFrame())
+        {
+            UnsubscribeFromEvent(E_ENDRENDERING);
+            PrintStats();
+            engine_->Exit();
+        }
+    }
+};
+
+URHO3D_DEFINE_APPLICATION_MAIN(SpriteReplay)
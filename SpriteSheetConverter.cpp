@@ -0,0 +1,91 @@
+// Конвертирует XML-атлас Urho2D (TextureAtlas) в бинарный атлас для SBSpriteSheet.
+//
+// SpriteSheetConverter <атлас.xml> <атлас.sbs>
+//
+// Номера кадров (frameId) соответствуют порядку SubTexture в XML. Они выводятся в консоль
+// вместе с именами кадров, чтобы их можно было скопировать в код.
+
+#include <Urho3D/Urho3DAll.h>
+#include "SBSpriteSheet.h"
+
+int main(int argc, char** argv)
+{
+    Vector<String> arguments = ParseArguments(argc, argv);
+    if (arguments.Size() < 2)
+    {
+        ErrorExit("Usage: SpriteSheetConverter <input.xml> <output.sbs>");
+        return 1;
+    }
+
+    SharedPtr<Context> context(new Context());
+    context->RegisterSubsystem(new FileSystem(context));
+    context->RegisterSubsystem(new Log(context));
+
+    String inputName = GetInternalPath(arguments[0]);
+    String outputName = GetInternalPath(arguments[1]);
+
+    File inputFile(context, inputName);
+    SharedPtr<XMLFile> xml(new XMLFile(context));
+    if (!inputFile.IsOpen() || !xml->Load(inputFile))
+        ErrorExit("Could not load " + inputName);
+
+    XMLElement rootElem = xml->GetRoot("TextureAtlas");
+    if (!rootElem)
+        ErrorExit(inputName + " is not a texture atlas");
+
+    // Размеры текстуры нужны для перевода областей кадров в текстурные координаты.
+    String textureName = rootElem.GetAttribute("imagePath");
+    File imageFile(context, GetPath(inputName) + textureName);
+    SharedPtr<Image> image(new Image(context));
+    if (!imageFile.IsOpen() || !image->Load(imageFile))
+        ErrorExit("Could not load " + GetPath(inputName) + textureName);
+
+    float invw = 1.0f / image->GetWidth();
+    float invh = 1.0f / image->GetHeight();
+
+    File outputFile(context, outputName, FILE_WRITE);
+    if (!outputFile.IsOpen())
+        ErrorExit("Could not open " + outputName);
+
+    unsigned frameCount = 0;
+    for (XMLElement subTextureElem = rootElem.GetChild("SubTexture"); subTextureElem; subTextureElem = subTextureElem.GetNext("SubTexture"))
+        frameCount++;
+
+    // Заголовок и кадры пишутся теми же структурами, которыми их читает SBSpriteSheet.
+    SBSheetHeader header;
+    memcpy(header.id_, SHEET_FILE_ID, sizeof(header.id_));
+    header.version_ = SHEET_VERSION;
+    header.frameCount_ = frameCount;
+    header.textureNameLength_ = textureName.Length();
+    outputFile.Write(&header, sizeof(header));
+
+    unsigned frameId = 0;
+    for (XMLElement subTextureElem = rootElem.GetChild("SubTexture"); subTextureElem; subTextureElem = subTextureElem.GetNext("SubTexture"))
+    {
+        float x = (float)subTextureElem.GetInt("x");
+        float y = (float)subTextureElem.GetInt("y");
+        float width = (float)subTextureElem.GetInt("width");
+        float height = (float)subTextureElem.GetInt("height");
+
+        // Точка привязки - центр исходного кадра, как в SpriteSheet2D. Если кадр обрезан,
+        // то frameX и frameY задают смещение обрезанной области (обычно отрицательное).
+        Vector2 pivot(width * 0.5f, height * 0.5f);
+        if (subTextureElem.HasAttribute("frameWidth") && subTextureElem.HasAttribute("frameHeight"))
+        {
+            pivot.x_ = subTextureElem.GetInt("frameX") + subTextureElem.GetInt("frameWidth") * 0.5f;
+            pivot.y_ = subTextureElem.GetInt("frameY") + subTextureElem.GetInt("frameHeight") * 0.5f;
+        }
+
+        SBSheetFrame frame;
+        frame.uv_ = Rect(x * invw, y * invh, (x + width) * invw, (y + height) * invh);
+        frame.pivot_ = pivot;
+        frame.size_ = Vector2(width, height);
+        outputFile.Write(&frame, sizeof(frame));
+
+        PrintLine(String(frameId++) + " " + subTextureElem.GetAttribute("name"));
+    }
+
+    outputFile.Write(textureName.CString(), textureName.Length());
+
+    return 0;
+}
@@ -29,6 +29,9 @@ public:
     int fpsFrameCounter_ = 0;
     int fpsValue_ = 0;
 
+    // Смешанная нагрузка: обычные, отраженные, повернутые и разноцветные спрайты вперемешку.
+    bool mixedWorkload_ = false;
+
     Game(Context* context) : Application(context)
     {
     }
@@ -130,6 +133,18 @@ public:
 
         if (INPUT->GetKeyPress(KEY_F2))
             DEBUG_HUD->ToggleAll();
+
+        if (INPUT->GetKeyPress(KEY_F3))
+            mixedWorkload_ = !mixedWorkload_;
+
+        // Запись кадров для SpriteReplay.
+        if (INPUT->GetKeyPress(KEY_F5))
+        {
+            if (spriteBatch_->IsCapturing())
+                spriteBatch_->StopCapture();
+            else
+                spriteBatch_->StartCapture(FILE_SYSTEM->GetProgramDir() + "Capture.sbc");
+        }
     }
 
     void SubscribeToEvents()
@@ -175,8 +190,40 @@ public:
 
         spriteBatch_->Begin();
 
-        for (int i = 0; i < 20000; i++)
-            spriteBatch_->Draw(ball, Vector2(Random(0.0f, 800.0f), Random(0.0f, 600.0f)), nullptr, Color::WHITE);
+        if (mixedWorkload_)
+        {
+            // Виды спрайтов чередуются, поэтому каждая порция смешанная: повернутые и обычные
+            // спрайты, отражение и разные цвета. Это самый тяжелый случай для генерации вершин.
+            Vector2 ballOrigin(ball->GetWidth() * 0.5f, ball->GetHeight() * 0.5f);
+            for (int i = 0; i < 20000; i++)
+            {
+                Vector2 position(Random(0.0f, 800.0f), Random(0.0f, 600.0f));
+
+                switch (i % 4)
+                {
+                case 0:
+                    spriteBatch_->Draw(ball, position, nullptr, Color::WHITE);
+                    break;
+
+                case 1:
+                    spriteBatch_->Draw(ball, position, nullptr, Color::WHITE, 0.0f, Vector2::ZERO, Vector2::ONE, SBE_FLIP_HORIZONTALLY);
+                    break;
+
+                case 2:
+                    spriteBatch_->Draw(ball, position, nullptr, Color::YELLOW, angle_, ballOrigin, Vector2(0.5f, 0.5f));
+                    break;
+
+                default:
+                    spriteBatch_->Draw(ball, position, nullptr, Color(Random(1.0f), Random(1.0f), Random(1.0f)));
+                    break;
+                }
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 20000; i++)
+                spriteBatch_->Draw(ball, Vector2(Random(0.0f, 800.0f), Random(0.0f, 600.0f)), nullptr, Color::WHITE);
+        }
 
         spriteBatch_->Draw(head, Vector2(200.0f, 200.0f), nullptr, Color::WHITE, 0.0f, Vector2::ZERO, Vector2::ONE, SBE_FLIP_BOTH);
 
@@ -184,7 +231,7 @@ public:
         Vector2 origin = Vector2(head->GetWidth() * 0.5f, head->GetHeight() * 0.5f);
         spriteBatch_->Draw(head, Vector2(400.0f, 300.0f), nullptr, Color::WHITE, angle_, origin, Vector2(scale, scale));
 
-        spriteBatch_->DrawString(String("FPS: ") + String(fpsValue_),
+        spriteBatch_->DrawString(String("FPS: ") + String(fpsValue_) + (mixedWorkload_ ? " (mixed)" : ""),
             CACHE->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 40.0f, Vector2(50.0f, 50.0f), Color::RED);
 
         spriteBatch_->DrawString("Mirrored Text", CACHE->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 40.0f,
@@ -193,6 +240,13 @@ public:
         spriteBatch_->DrawString("Some Text", CACHE->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 40.0f,
             Vector2(400.0f, 300.0f), Color::BLUE, angle_, Vector2::ZERO, Vector2(scale, scale));
 
+        // Примитивы попадают в тот же пакет.
+        spriteBatch_->DrawRect(Rect(600.0f, 50.0f, 600.0f + 150.0f * scale * 0.5f, 70.0f), Color::GREEN);
+        spriteBatch_->DrawRectOutline(Rect(600.0f, 50.0f, 750.0f, 70.0f), Color::WHITE, 2.0f);
+        spriteBatch_->DrawLine(Vector2(400.0f, 300.0f), Vector2(400.0f, 300.0f) + Vector2(Cos(angle_), Sin(angle_)) * 100.0f, Color::YELLOW, 3.0f);
+        spriteBatch_->DrawCircle(Vector2(400.0f, 300.0f), 100.0f, Color::YELLOW, 2.0f);
+        spriteBatch_->DrawFilledCircle(Vector2(700.0f, 500.0f), 50.0f, Color::CYAN);
+
         spriteBatch_->End();
     }
 };